@@ -3,28 +3,223 @@
 #include <alsa/asoundlib.h>
 #include <mpg123.h>
 #include <math.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#define AD_LOOKAHEAD_DEFAULT 4
+#define AD_LOOKAHEAD_MAX 64
+
+#define AD_IDLE_SECONDS_DEFAULT 5
+#define AD_LEAD_IN_MS_DEFAULT 20
+
+typedef enum ad_device_state {
+    AD_DEVICE_ACTIVE,
+    AD_DEVICE_PAUSED,
+    AD_DEVICE_SUSPENDED,
+    AD_DEVICE_SILENCE
+} ad_device_state_t;
+
+/* single producer / single consumer ring of period-sized blocks */
+typedef struct ad_ring {
+    unsigned char *data;
+    size_t *size;
+    size_t block_bytes;
+    int depth;
+    atomic_uint head, tail;
+    atomic_int eof, abort;
+    sem_t filled, free;
+    unsigned char *partial;     // producer block being filled by ad_play_raw
+    size_t partial_bytes;
+    int started, delay_seen;
+    unsigned long pops, fill_sum, empty_waits, starving;
+    int fill_min, fill_max;
+} ad_ring_t;
+
+typedef struct ad_ogg_args {
+    const char *path;
+    float volume;
+} ad_ogg_args_t;
 
 static snd_pcm_t *pcm_handle;
+static snd_pcm_uframes_t period_frames, buffer_frames;
+static unsigned char *silence;
+static int can_pause;
 
 static mpg123_handle *mpg_handle_feed, *mpg_handle_file;
 static unsigned char *mpg_buffer;
 static size_t mpg_buffer_size;
 
-static pthread_t lipsync_thread;
-static pthread_mutex_t access_lock, sync_lock;
+/* per-handle state, reset whenever the handles are recreated */
+static int file_first_time, feed_first_time;
+static float file_prev_volume, feed_prev_volume;
+
+static pthread_t lipsync_thread, producer_thread;
+static pthread_mutex_t access_lock, sync_lock, stats_lock;
+
+static ad_ring_t ring;
+static int lookahead = AD_LOOKAHEAD_DEFAULT;
+static ad_pipeline_stats_t pipeline_stats;
+
+static pthread_t idle_thread;
+static pthread_mutex_t idle_lock;
+static pthread_cond_t idle_cond;
+static ad_idle_policy_t idle_policy = AD_IDLE_NONE;
+static ad_device_state_t device_state = AD_DEVICE_ACTIVE;
+static int idle_seconds = AD_IDLE_SECONDS_DEFAULT;
+static snd_pcm_uframes_t lead_in_frames = AD_LEAD_IN_MS_DEFAULT * SAMPLE_RATE / 1000;
+static struct timespec idle_since;
+static int idle_armed = 0;
+static atomic_int idle_quit = 0;
+static atomic_int idle_wake = 0;    // threads waiting for access_lock
+static atomic_int idle_gen = 0;     // bumped on every policy change
+
+static snd_pcm_uframes_t arm_ahead;     // frames queued ahead of the first real sample at arm
+static snd_pcm_uframes_t lipsync_lead;
+static snd_pcm_sframes_t arm_avail;
+static struct timespec resume_start;    // when the current ad_play_* call was entered
+static int resume_pending = 0;
+static long resume_latency_us = -1;
 
 static int play_id = 0;
 static int stop = 0;
 
 void ad_init_rubberband();
-void ad_play_ogg_file_pitched(const char *path, float volume, viseme_timing_t *t, int *stop);
+void ad_play_ogg_file_pitched(const char *path, float volume, int *stop);
+
+/* a lead-in that fills the buffer would never reach the start threshold */
+snd_pcm_uframes_t _ad_lead_in_clamp(snd_pcm_uframes_t frames) {
+    snd_pcm_uframes_t limit = buffer_frames - period_frames;
+    if (buffer_frames && frames > limit) return limit;
+    return frames;
+}
+
+void _ad_ring_alloc(int depth) {
+    if (ring.data) {
+        free(ring.data);
+        free(ring.size);
+        sem_destroy(&ring.filled);
+        sem_destroy(&ring.free);
+    }
+    ring.depth = depth;
+    ring.block_bytes = period_frames * 4;
+    ring.data = (unsigned char*) malloc(ring.depth * ring.block_bytes);
+    ring.size = (size_t*) malloc(ring.depth * sizeof(size_t));
+    sem_init(&ring.filled, 0, 0);
+    sem_init(&ring.free, 0, ring.depth);
+}
+
+void _ad_ring_reset() {
+    atomic_store(&ring.head, 0);
+    atomic_store(&ring.tail, 0);
+    atomic_store(&ring.eof, 0);
+    atomic_store(&ring.abort, 0);
+    sem_destroy(&ring.filled);
+    sem_destroy(&ring.free);
+    sem_init(&ring.filled, 0, 0);
+    sem_init(&ring.free, 0, ring.depth);
+
+    ring.partial = NULL;
+    ring.partial_bytes = 0;
+
+    ring.started = ring.delay_seen = 0;
+    ring.pops = ring.fill_sum = ring.empty_waits = ring.starving = 0;
+    ring.fill_min = ring.depth;
+    ring.fill_max = 0;
+}
+
+// producer side: returns the next free block, or NULL once the consumer gave up
+unsigned char *_ad_ring_acquire() {
+    if (atomic_load(&ring.abort)) return NULL;
+    while (sem_wait(&ring.free) == -1 && errno == EINTR);
+    if (atomic_load(&ring.abort)) return NULL;
+
+    unsigned int head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    return ring.data + (head % ring.depth) * ring.block_bytes;
+}
+
+void _ad_ring_commit(size_t bytes) {
+    unsigned int head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    ring.size[head % ring.depth] = bytes;
+    atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+    sem_post(&ring.filled);
+}
+
+void _ad_ring_flush() {
+    if (ring.partial) {
+        _ad_ring_commit(ring.partial_bytes);
+        ring.partial = NULL;
+        ring.partial_bytes = 0;
+    }
+}
+
+void _ad_ring_close() {
+    atomic_store(&ring.eof, 1);
+    sem_post(&ring.filled);
+}
+
+// consumer side: returns the oldest filled block, or NULL at end of stream
+unsigned char *_ad_ring_peek(size_t *bytes) {
+    unsigned int tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    if (ring.started) {
+        // null and file never report a queue, starving can only be judged on real devices
+        snd_pcm_sframes_t delay = 0;
+        int xrun = snd_pcm_delay(pcm_handle, &delay) < 0;
+        if (xrun || delay > 0) ring.delay_seen = 1;
+
+        if (head == tail && !atomic_load(&ring.eof)) {
+            ring.empty_waits++;
+            if (xrun || delay <= (snd_pcm_sframes_t)period_frames) ring.starving++;
+        }
+    }
+
+    while (sem_wait(&ring.filled) == -1 && errno == EINTR);
+
+    head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    if (head == tail) return NULL;
+
+    int fill = head - tail;
+    if (fill < ring.fill_min) ring.fill_min = fill;
+    if (fill > ring.fill_max) ring.fill_max = fill;
+    ring.fill_sum += fill;
+    ring.pops++;
+    ring.started = 1;
+
+    *bytes = ring.size[tail % ring.depth];
+    return ring.data + (tail % ring.depth) * ring.block_bytes;
+}
+
+void _ad_ring_release() {
+    unsigned int tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    atomic_store_explicit(&ring.tail, tail + 1, memory_order_release);
+    sem_post(&ring.free);
+}
+
+void _ad_ring_abort() {
+    atomic_store(&ring.abort, 1);
+    sem_post(&ring.free);
+}
+
+void *_ad_idle_thread(void *obj);
+void _ad_idle_touch();
+
+/* anyone waiting here makes the idle thread hand the device back */
+void _ad_access_lock() {
+    atomic_fetch_add(&idle_wake, 1);
+    pthread_mutex_lock(&access_lock);
+    atomic_fetch_sub(&idle_wake, 1);
+}
 
 void ad_init() {
+    ad_init_device("plughw:1,0");
+}
+
+void ad_init_device(const char *device) {
     /* asoundlib initializations */
     int err;
     snd_pcm_hw_params_t *params;
 
-    char *device = "plughw:1,0";
     err = snd_pcm_open(&pcm_handle, device, SND_PCM_STREAM_PLAYBACK, 0);
     if (err < 0) printf("ERROR: Can't open \"%s\" PCM device. %s\n", device, snd_strerror(err));
 
@@ -47,6 +242,15 @@ void ad_init() {
     err = snd_pcm_hw_params(pcm_handle, params);
     if (err < 0) printf("ERROR: Can't set harware parameters. %s\n", snd_strerror(err));
 
+    err = snd_pcm_hw_params_get_period_size(params, &period_frames, NULL);
+    if (err < 0 || period_frames == 0) period_frames = 1024;
+
+    err = snd_pcm_hw_params_get_buffer_size(params, &buffer_frames);
+    if (err < 0 || buffer_frames < period_frames) buffer_frames = period_frames;
+
+    can_pause = snd_pcm_hw_params_can_pause(params);
+    silence = (unsigned char*) calloc(period_frames, 4);
+
     /* mpg123 initializations */
     mpg123_init();
 
@@ -62,14 +266,51 @@ void ad_init() {
 
     mpg123_open_feed(mpg_handle_feed);
 
-    if (pthread_mutex_init(&access_lock, NULL) != 0 || pthread_mutex_init(&sync_lock, NULL) != 0) {
+    file_first_time = feed_first_time = 1;
+    file_prev_volume = feed_prev_volume = 1.0;
+
+    if (pthread_mutex_init(&access_lock, NULL) != 0 || pthread_mutex_init(&sync_lock, NULL) != 0
+            || pthread_mutex_init(&stats_lock, NULL) != 0 || pthread_mutex_init(&idle_lock, NULL) != 0) {
         printf("ad_init mutex init failed\n");
     }
+    // the board has no RTC, NTP steps must not move the idle deadline
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&idle_cond, &attr) != 0) {
+        printf("ad_init cond init failed\n");
+    }
+    pthread_condattr_destroy(&attr);
+
+    _ad_ring_alloc(lookahead);
 
     ad_init_rubberband();
+
+    pthread_mutex_lock(&idle_lock);
+    lead_in_frames = _ad_lead_in_clamp(lead_in_frames);
+    pthread_mutex_unlock(&idle_lock);
+
+    atomic_store(&idle_quit, 0);
+    device_state = AD_DEVICE_ACTIVE;
+    _ad_idle_touch();
+    pthread_create(&idle_thread, NULL, _ad_idle_thread, NULL);
 }
 
 void ad_destroy() {
+    pthread_mutex_lock(&idle_lock);
+    atomic_store(&idle_quit, 1);
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+    pthread_join(idle_thread, NULL);
+
+    if (pcm_handle) {
+        snd_pcm_drop(pcm_handle);
+        snd_pcm_close(pcm_handle);
+        pcm_handle = NULL;
+    }
+    free(silence);
+    silence = NULL;
+
     free(mpg_buffer);
     mpg123_close(mpg_handle_feed);
     mpg123_close(mpg_handle_file);
@@ -77,8 +318,274 @@ void ad_destroy() {
     mpg123_delete(mpg_handle_file);
     mpg123_exit();
 
+    free(ring.data);
+    free(ring.size);
+    ring.data = NULL;
+    ring.size = NULL;
+    sem_destroy(&ring.filled);
+    sem_destroy(&ring.free);
+
     pthread_mutex_destroy(&access_lock);
     pthread_mutex_destroy(&sync_lock);
+    pthread_mutex_destroy(&stats_lock);
+    pthread_mutex_destroy(&idle_lock);
+    pthread_cond_destroy(&idle_cond);
+}
+
+void ad_set_lookahead(int blocks) {
+    if (blocks < 1) blocks = 1;
+    if (blocks > AD_LOOKAHEAD_MAX) blocks = AD_LOOKAHEAD_MAX;
+
+    _ad_access_lock();
+    lookahead = blocks;
+    _ad_ring_alloc(lookahead);
+    pthread_mutex_unlock(&access_lock);
+    _ad_idle_touch();
+}
+
+void ad_get_pipeline_stats(ad_pipeline_stats_t *stats) {
+    pthread_mutex_lock(&stats_lock);
+    *stats = pipeline_stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void ad_set_idle_policy(ad_idle_policy_t policy, int seconds, int lead_in_ms) {
+    if (seconds < 1) seconds = 1;
+    if (lead_in_ms < 0) lead_in_ms = 0;
+
+    pthread_mutex_lock(&idle_lock);
+    idle_policy = policy;
+    idle_seconds = seconds;
+    lead_in_frames = _ad_lead_in_clamp((snd_pcm_uframes_t)lead_in_ms * SAMPLE_RATE / 1000);
+    atomic_fetch_add(&idle_gen, 1);
+    clock_gettime(CLOCK_MONOTONIC, &idle_since);
+    idle_armed = 1;
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+long ad_get_resume_latency_us() {
+    pthread_mutex_lock(&stats_lock);
+    long us = resume_latency_us;
+    pthread_mutex_unlock(&stats_lock);
+    return us;
+}
+
+/* zeros below the threshold stay queued until real audio is written behind them */
+void _ad_set_start_threshold(snd_pcm_uframes_t frames) {
+    snd_pcm_sw_params_t *swparams;
+    snd_pcm_sw_params_alloca(&swparams);
+    snd_pcm_sw_params_current(pcm_handle, swparams);
+
+    int err = snd_pcm_sw_params_set_start_threshold(pcm_handle, swparams, frames);
+    if (err == 0) err = snd_pcm_sw_params(pcm_handle, swparams);
+    if (err < 0) printf("ERROR: Can't set start threshold. %s\n", snd_strerror(err));
+}
+
+void _ad_start() {
+    if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED) snd_pcm_start(pcm_handle);
+}
+
+void _ad_write_silence(snd_pcm_uframes_t frames) {
+    while (frames > 0) {
+        snd_pcm_uframes_t n = frames < period_frames ? frames : period_frames;
+        snd_pcm_sframes_t written = snd_pcm_writei(pcm_handle, silence, n);
+        if (written < 0) {
+            int err = snd_pcm_recover(pcm_handle, written, 1);
+            if (err < 0) {
+                printf("snd_pcm_writei silence error: %s\n", snd_strerror(err));
+                return;
+            }
+            continue;
+        }
+        frames -= written;
+    }
+}
+
+/* policy and lead-in may change under idle_lock while the device is in use */
+void _ad_idle_snapshot(ad_idle_policy_t *policy, snd_pcm_uframes_t *lead_in) {
+    pthread_mutex_lock(&idle_lock);
+    *policy = idle_policy;
+    *lead_in = lead_in_frames;
+    pthread_mutex_unlock(&idle_lock);
+}
+
+/* brings the device out of idle so that only the lead-in precedes the next write */
+void _ad_device_arm() {
+    ad_idle_policy_t policy;
+    snd_pcm_uframes_t lead_in;
+    _ad_idle_snapshot(&policy, &lead_in);
+
+    resume_pending = 1;
+    arm_ahead = 0;
+
+    if (policy == AD_IDLE_NONE) {
+        snd_pcm_drop(pcm_handle);
+        snd_pcm_prepare(pcm_handle);
+        _ad_set_start_threshold(1);
+        device_state = AD_DEVICE_ACTIVE;
+        arm_avail = snd_pcm_avail_update(pcm_handle);
+        return;
+    }
+
+    snd_pcm_sframes_t delay = 0;
+    _ad_set_start_threshold(lead_in + 1);
+
+    switch (device_state) {
+    case AD_DEVICE_SILENCE:
+        // discard queued zeros down to the lead-in, top up if it ran short
+        if (snd_pcm_delay(pcm_handle, &delay) == 0) {
+            snd_pcm_sframes_t rewind = delay - (snd_pcm_sframes_t)lead_in;
+            snd_pcm_sframes_t rewindable = snd_pcm_rewindable(pcm_handle);
+            if (rewind > rewindable) rewind = rewindable;
+            if (rewind > 0) {
+                snd_pcm_sframes_t rewound = snd_pcm_rewind(pcm_handle, rewind);
+                if (rewound > 0) delay -= rewound;
+            }
+            if (delay < (snd_pcm_sframes_t)lead_in) _ad_write_silence(lead_in - delay);
+            arm_ahead = delay > (snd_pcm_sframes_t)lead_in ? delay : lead_in;
+            break;
+        }
+        // xrun while nobody was feeding zeros, start over
+        snd_pcm_drop(pcm_handle);
+        snd_pcm_prepare(pcm_handle);
+        _ad_write_silence(lead_in);
+        arm_ahead = lead_in;
+        break;
+    case AD_DEVICE_PAUSED:
+        // part of the lead-in played before the pause took effect, top it up
+        if (snd_pcm_pause(pcm_handle, 0) == 0 && snd_pcm_delay(pcm_handle, &delay) == 0) {
+            if (delay < (snd_pcm_sframes_t)lead_in) _ad_write_silence(lead_in - delay);
+            arm_ahead = delay > (snd_pcm_sframes_t)lead_in ? delay : lead_in;
+            break;
+        }
+        // fall through
+    case AD_DEVICE_ACTIVE:
+        snd_pcm_drop(pcm_handle);
+        // fall through
+    case AD_DEVICE_SUSPENDED:
+        snd_pcm_prepare(pcm_handle);
+        _ad_write_silence(lead_in);
+        arm_ahead = lead_in;
+        break;
+    }
+
+    device_state = AD_DEVICE_ACTIVE;
+    arm_avail = snd_pcm_avail_update(pcm_handle);
+}
+
+/* called by the idle thread with access_lock held */
+void _ad_device_idle(ad_idle_policy_t policy, snd_pcm_uframes_t lead_in, int gen) {
+    snd_pcm_drop(pcm_handle);
+    device_state = AD_DEVICE_SUSPENDED;
+
+    switch (policy) {
+    case AD_IDLE_PAUSE:
+        if (!can_pause) break;
+        snd_pcm_prepare(pcm_handle);
+        _ad_set_start_threshold(lead_in + 1);
+        _ad_write_silence(lead_in);
+        _ad_start();
+        if (snd_pcm_pause(pcm_handle, 1) == 0) {
+            device_state = AD_DEVICE_PAUSED;
+        } else {
+            snd_pcm_drop(pcm_handle);
+        }
+        break;
+    case AD_IDLE_SILENCE:
+        snd_pcm_prepare(pcm_handle);
+        device_state = AD_DEVICE_SILENCE;
+        while (!atomic_load(&idle_wake) && !atomic_load(&idle_quit) && atomic_load(&idle_gen) == gen) {
+            _ad_write_silence(period_frames);
+            _ad_start();
+            // plugins like null and file never block on write, pace to the device rate
+            usleep(period_frames * 1000000L / SAMPLE_RATE / 2);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void *_ad_idle_thread(void *obj) {
+    pthread_mutex_lock(&idle_lock);
+    while (!atomic_load(&idle_quit)) {
+        if (!idle_armed || idle_policy == AD_IDLE_NONE) {
+            pthread_cond_wait(&idle_cond, &idle_lock);
+            continue;
+        }
+
+        struct timespec deadline = idle_since;
+        deadline.tv_sec += idle_seconds;
+        if (pthread_cond_timedwait(&idle_cond, &idle_lock, &deadline) != ETIMEDOUT) continue;
+
+        idle_armed = 0;
+        ad_idle_policy_t policy = idle_policy;
+        snd_pcm_uframes_t lead_in = lead_in_frames;
+        int gen = atomic_load(&idle_gen);
+        pthread_mutex_unlock(&idle_lock);
+        int busy = 1;
+        if (pcm_handle && pthread_mutex_trylock(&access_lock) == 0) {
+            busy = 0;
+            _ad_device_idle(policy, lead_in, gen);
+            pthread_mutex_unlock(&access_lock);
+        }
+        pthread_mutex_lock(&idle_lock);
+
+        // the holder may not be a playback that re-arms us when it finishes
+        if (busy && pcm_handle) {
+            clock_gettime(CLOCK_MONOTONIC, &idle_since);
+            idle_armed = 1;
+        }
+    }
+    pthread_mutex_unlock(&idle_lock);
+
+    return NULL;
+}
+
+void _ad_idle_touch() {
+    pthread_mutex_lock(&idle_lock);
+    clock_gettime(CLOCK_MONOTONIC, &idle_since);
+    idle_armed = 1;
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_lock);
+}
+
+void _ad_write(const void *data, snd_pcm_uframes_t frames) {
+    if (resume_pending) {
+        /*
+         * first real sample: time since the play call plus the frames still
+         * queued ahead of it. The queue is our own count from arm, less what
+         * the device consumed since, because null and file report no delay.
+         */
+        resume_pending = 0;
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm_handle);
+        snd_pcm_sframes_t consumed = avail < 0 || arm_avail < 0 ? (snd_pcm_sframes_t)arm_ahead : avail - arm_avail;
+        if (consumed < 0) consumed = 0;
+        if (consumed > (snd_pcm_sframes_t)arm_ahead) consumed = arm_ahead;
+        snd_pcm_sframes_t queued = arm_ahead - consumed;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long us = (now.tv_sec - resume_start.tv_sec) * 1000000L + (now.tv_nsec - resume_start.tv_nsec) / 1000;
+
+        pthread_mutex_lock(&stats_lock);
+        resume_latency_us = us + queued * 1000000L / SAMPLE_RATE;
+        pthread_mutex_unlock(&stats_lock);
+    }
+
+    snd_pcm_sframes_t err = snd_pcm_writei(pcm_handle, data, frames);
+    if (err < 0) {
+        err = snd_pcm_recover(pcm_handle, err, 1);
+        if (err == 0) err = snd_pcm_writei(pcm_handle, data, frames);
+    }
+    if (err < 0) {
+        printf("snd_pcm_writei error: %s\n", snd_strerror(err));
+        return;
+    }
+
+    // short writes may stay below the start threshold
+    _ad_start();
 }
 
 void _ad_play_prepare(mpg123_handle *mh) {
@@ -107,6 +614,9 @@ void *_ad_lipsync_thread(void *obj) {
     int sleepMS = 100;
     int fraction = round((sleepMS / 1000.0) * (double)SAMPLE_RATE);
 
+    // visemes start with the first real sample, not with the zeros queued ahead of it
+    usleep(lipsync_lead * 1000000L / SAMPLE_RATE);
+
     while (!stop && t && t->next_timing < t->timing_size) {
         int elapsedMS = ((double)current_sample / (double)SAMPLE_RATE) * 1000;
 
@@ -125,13 +635,13 @@ void *_ad_lipsync_thread(void *obj) {
 }
 
 void ad_play_sync_prep(viseme_timing_t *t) {
-    snd_pcm_drop(pcm_handle);
-    snd_pcm_prepare(pcm_handle);
+    _ad_device_arm();
 
     pthread_mutex_lock(&sync_lock);
     if (lipsync_thread) {
         pthread_join(lipsync_thread, NULL);
     }
+    lipsync_lead = arm_ahead;
     pthread_create(&lipsync_thread, NULL, _ad_lipsync_thread, t);
     pthread_mutex_unlock(&sync_lock);
 }
@@ -145,97 +655,153 @@ void ad_play_sync_cleanup() {
     pthread_mutex_unlock(&sync_lock);
 }
 
+void *_ad_mp3_producer(void *obj) {
+    mpg123_handle *mh = (mpg123_handle *)obj;
+    unsigned char *block;
+    size_t done;
+
+    while (!stop && (block = _ad_ring_acquire()) != NULL) {
+        int c = mpg123_read(mh, block, ring.block_bytes, &done);
+        if (c == MPG123_OK || c == MPG123_DONE) {
+            _ad_ring_commit(done);
+        } else {
+            printf("ad_play_audio_file error %d\n", c);
+            break;
+        }
+
+        if (c == MPG123_DONE) {
+            break;
+        }
+    }
+
+    _ad_ring_close();
+    return NULL;
+}
+
+void *_ad_ogg_producer(void *obj) {
+    ad_ogg_args_t *args = (ad_ogg_args_t *)obj;
+    ad_play_ogg_file_pitched(args->path, args->volume, &stop);
+    _ad_ring_flush();
+    _ad_ring_close();
+    return NULL;
+}
+
+/*
+ * decodes on a producer thread while this thread alone touches the device,
+ * the device is only armed once the first block is ready so a resumed
+ * stream never waits on thread start-up or the first decode
+ */
+void _ad_pipeline_run(void *(*producer)(void *), void *arg, viseme_timing_t *t) {
+    unsigned char *block;
+    size_t bytes;
+    int sync = 1;
+
+    _ad_ring_reset();
+    pthread_create(&producer_thread, NULL, producer, arg);
+
+    while (!stop && (block = _ad_ring_peek(&bytes)) != NULL) {
+        if (sync) {
+            sync = 0;
+            ad_play_sync_prep(t);
+        }
+        _ad_write(block, bytes / 4);
+        _ad_ring_release();
+    }
+
+    _ad_ring_abort();
+    pthread_join(producer_thread, NULL);
+
+    pthread_mutex_lock(&stats_lock);
+    pipeline_stats.depth = ring.depth;
+    pipeline_stats.block_frames = period_frames;
+    pipeline_stats.blocks = ring.pops;
+    pipeline_stats.min_fill = ring.pops ? ring.fill_min : 0;
+    pipeline_stats.max_fill = ring.fill_max;
+    pipeline_stats.avg_fill = ring.pops ? (double)ring.fill_sum / ring.pops : 0.0;
+    pipeline_stats.empty_waits = ring.empty_waits;
+    pipeline_stats.underruns = ring.delay_seen ? (long)ring.starving : -1;
+    pthread_mutex_unlock(&stats_lock);
+}
+
 int ad_wait_ready() {
     stop = 1;
-    pthread_mutex_lock(&access_lock);
+    _ad_access_lock();
     int id = ++play_id;
     pthread_mutex_unlock(&access_lock);
     return id;
 }
 
 void ad_play_mp3_file(int id, const char *path, float volume, viseme_timing_t *t) {
-    static int first_time = 1;
-    static float prev_volume = 1.0;
+    struct timespec entry;
+    clock_gettime(CLOCK_MONOTONIC, &entry);
 
     if (id != play_id) return;
     stop = 1;
-    pthread_mutex_lock(&access_lock);
+    _ad_access_lock();
     if (id != play_id) {
         pthread_mutex_unlock(&access_lock);
         return;
     }
     stop = 0;
+    resume_start = entry;
 
     mpg123_open(mpg_handle_file, path);
 
-    if (first_time) {
-        first_time = 0;
+    if (file_first_time) {
+        file_first_time = 0;
         _ad_play_prepare(mpg_handle_file);
     }
-    if (volume != prev_volume) {
-        prev_volume = volume;
+    if (volume != file_prev_volume) {
+        file_prev_volume = volume;
         mpg123_volume(mpg_handle_file, volume);
     }
 
-    ad_play_sync_prep(t);
-
-    size_t done;
-    while (!stop) {
-        int c = mpg123_read(mpg_handle_file, mpg_buffer, mpg_buffer_size, &done);
-        if (c == MPG123_OK || c == MPG123_DONE) {
-            int err = snd_pcm_writei(pcm_handle, mpg_buffer, done / 4);
-            if (err < 0) printf("snd_pcm_writei error: %s\n", snd_strerror(err));
-        } else {
-            printf("ad_play_audio_file error %d\n", c);
-            break;
-        }
-
-        if (c == MPG123_DONE) {
-            break;
-        }
-    }
+    _ad_pipeline_run(_ad_mp3_producer, mpg_handle_file, t);
 
     ad_play_sync_cleanup();
 
     mpg123_close(mpg_handle_file);
     _ad_timing_cancel(t);
 
+    _ad_idle_touch();
     pthread_mutex_unlock(&access_lock);
 }
 
 void ad_play_mp3_buffer(int id, const char *buffer, unsigned int size, float volume, viseme_timing_t *t) {
-    static int first_time = 1;
-    static float prev_volume = 1.0;
+    struct timespec entry;
+    clock_gettime(CLOCK_MONOTONIC, &entry);
 
     if (id != play_id) return;
     stop = 1;
-    pthread_mutex_lock(&access_lock);
+    _ad_access_lock();
     if (id != play_id) {
         pthread_mutex_unlock(&access_lock);
         return;
     }
     stop = 0;
+    resume_start = entry;
 
     mpg123_feed(mpg_handle_feed, buffer, size);
 
-    if (first_time) {
-        first_time = 0;
+    if (feed_first_time) {
+        feed_first_time = 0;
         _ad_play_prepare(mpg_handle_feed);
     }
-    if (volume != prev_volume) {
-        prev_volume = volume;
+    if (volume != feed_prev_volume) {
+        feed_prev_volume = volume;
         mpg123_volume(mpg_handle_feed, volume);
     }
 
-    snd_pcm_drop(pcm_handle);
-    snd_pcm_prepare(pcm_handle);
-
     size_t done;
+    int armed = 0;
     while (!stop) {
         int c = mpg123_read(mpg_handle_feed, mpg_buffer, mpg_buffer_size, &done);
         if (c == MPG123_OK || c == MPG123_NEED_MORE) {
-            int err = snd_pcm_writei(pcm_handle, mpg_buffer, done / 4);
-            if (err < 0) printf("snd_pcm_writei error: %s\n", snd_strerror(err));
+            if (!armed) {
+                armed = 1;
+                _ad_device_arm();
+            }
+            _ad_write(mpg_buffer, done / 4);
         } else {
             printf("ad_play_audio_buffer error %d\n", c);
             break;
@@ -248,26 +814,50 @@ void ad_play_mp3_buffer(int id, const char *buffer, unsigned int size, float vol
 
     snd_pcm_drain(pcm_handle);
 
+    _ad_idle_touch();
     pthread_mutex_unlock(&access_lock);
 }
 
 void ad_play_ogg_file(int id, const char *path, float volume, viseme_timing_t *t) {
+    struct timespec entry;
+    clock_gettime(CLOCK_MONOTONIC, &entry);
+
     if (id != play_id) return;
     stop = 1;
-    pthread_mutex_lock(&access_lock);
+    _ad_access_lock();
     if (id != play_id) {
         pthread_mutex_unlock(&access_lock);
         return;
     }
     stop = 0;
+    resume_start = entry;
 
-    ad_play_ogg_file_pitched(path, volume, t, &stop);
+    ad_ogg_args_t args = { path, volume };
+    _ad_pipeline_run(_ad_ogg_producer, &args, t);
+
+    ad_play_sync_cleanup();
 
     _ad_timing_cancel(t);
+    _ad_idle_touch();
     pthread_mutex_unlock(&access_lock);
 }
 
+// called from the ogg producer thread, packs processed audio into whole blocks for the writer
 void ad_play_raw(char *data, size_t count) {
-    int err = snd_pcm_writei(pcm_handle, data, count / 4);
-    if (err < 0) printf("snd_pcm_writei error: %s\n", snd_strerror(err));
+    while (count > 0) {
+        if (!ring.partial) {
+            ring.partial = _ad_ring_acquire();
+            if (!ring.partial) return;
+        }
+
+        size_t bytes = ring.block_bytes - ring.partial_bytes;
+        if (bytes > count) bytes = count;
+        memcpy(ring.partial + ring.partial_bytes, data, bytes);
+        ring.partial_bytes += bytes;
+
+        if (ring.partial_bytes == ring.block_bytes) _ad_ring_flush();
+
+        data += bytes;
+        count -= bytes;
+    }
 }
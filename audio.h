@@ -17,7 +17,27 @@ typedef struct viseme_timing {
     int *timing;
 } viseme_timing_t;
 
+typedef struct ad_pipeline_stats {
+    int depth;              // lookahead depth in blocks
+    int block_frames;       // frames per block (one device period)
+    unsigned long blocks;   // blocks written to the device
+    int min_fill;           // ring occupancy seen by the writer, in blocks
+    int max_fill;
+    double avg_fill;
+    unsigned long empty_waits; // writer found the ring empty mid-stream
+    long underruns;         // empty waits with at most one period left on the device,
+                            // -1 when the device never reports a queue (null, file)
+} ad_pipeline_stats_t;
+
+typedef enum ad_idle_policy {
+    AD_IDLE_NONE,       // leave the device prepared, cold drop/prepare on every play
+    AD_IDLE_PAUSE,      // pause the stream with a silence lead-in already queued
+    AD_IDLE_SUSPEND,    // stop the stream so the codec can power down
+    AD_IDLE_SILENCE     // keep the stream running on zeros
+} ad_idle_policy_t;
+
 void ad_init();
+void ad_init_device(const char *device);
 void ad_destroy();
 
 int ad_wait_ready();
@@ -25,6 +45,12 @@ void ad_play_mp3_file(int id, const char *path, float volume, viseme_timing_t *t
 void ad_play_mp3_buffer(int id, const char *buffer, unsigned int size, float volume, viseme_timing_t *t);
 void ad_play_ogg_file(int id, const char *path, float volume, viseme_timing_t *t);
 
+void ad_set_lookahead(int blocks);
+void ad_get_pipeline_stats(ad_pipeline_stats_t *stats);
+
+void ad_set_idle_policy(ad_idle_policy_t policy, int idle_seconds, int lead_in_ms);
+long ad_get_resume_latency_us();
+
 #ifdef __cplusplus
 }
 #endif
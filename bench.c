@@ -0,0 +1,61 @@
+#include "audio.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static const char *policy_names[] = { "none", "pause", "suspend", "silence" };
+
+static void bench_device(const char *device, int rounds) {
+    ad_init_device(device);
+
+    for (int p = AD_IDLE_NONE; p <= AD_IDLE_SILENCE; p++) {
+        ad_set_idle_policy((ad_idle_policy_t)p, 1, 20);
+
+        long min = -1, max = -1, sum = 0;
+        for (int i = 0; i < rounds; i++) {
+            // let the idle policy kick in before every play
+            sleep(2);
+            ad_play_mp3_file(ad_wait_ready(), "audio/blink.mp3", 1.0, NULL);
+
+            // play call entry to the first sample leaving the device, lead-in included
+            long us = ad_get_resume_latency_us();
+            if (min < 0 || us < min) min = us;
+            if (us > max) max = us;
+            sum += us;
+        }
+
+        printf("%-40s %-8s min %6ld us  avg %6ld us  max %6ld us\n",
+                device, policy_names[p], min, sum / rounds, max);
+    }
+
+    ad_set_idle_policy(AD_IDLE_NONE, 1, 0);
+
+    static const int depths[] = { 1, 2, 4, 8, 16 };
+    for (int d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        ad_set_lookahead(depths[d]);
+        ad_play_mp3_file(ad_wait_ready(), "audio/blink.mp3", 1.0, NULL);
+
+        ad_pipeline_stats_t stats;
+        ad_get_pipeline_stats(&stats);
+        printf("%-40s depth %2d x %4d frames  blocks %5lu  fill min %2d avg %5.2f max %2d  empty %lu  ",
+                device, stats.depth, stats.block_frames, stats.blocks,
+                stats.min_fill, stats.avg_fill, stats.max_fill, stats.empty_waits);
+        if (stats.underruns < 0) printf("underruns n/a (no device queue)\n");
+        else printf("underruns %ld\n", stats.underruns);
+    }
+
+    ad_destroy();
+}
+
+int main (int argc, char **argv) {
+    int rounds = 5;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) bench_device(argv[i], rounds);
+    } else {
+        bench_device("null", rounds);
+        bench_device("file:FILE=/tmp/rovy_audio_bench.raw,FORMAT=raw", rounds);
+    }
+
+    return 0;
+}
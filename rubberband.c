@@ -34,8 +34,6 @@ typedef struct sf_user_data {
     float volume;
 } sf_user_data_;
 
-void ad_play_sync_prep(viseme_timing_t *t);
-void ad_play_sync_cleanup();
 void ad_play_raw(char *data, size_t count);
 
 //************* virtual local functions ************************
@@ -148,6 +146,7 @@ void ad_init_rubberband() {
         break;
     }
 
+    frequencyshift = 1.0;
     if (pitchshift != 0.0) {
         frequencyshift *= pow(2.0, pitchshift / 12);
     }
@@ -166,7 +165,7 @@ void ad_init_rubberband() {
     sfinfoOut.samplerate = SAMPLE_RATE;
 }
 
-void ad_play_ogg_file_pitched(const char *path, float volume, viseme_timing_t *t, int *stop) {
+void ad_play_ogg_file_pitched(const char *path, float volume, int *stop) {
 
     SNDFILE *sndfile;
     SF_INFO sfinfo;
@@ -245,7 +244,6 @@ void ad_play_ogg_file_pitched(const char *path, float volume, viseme_timing_t *t
     percent = 0;
 
     size_t countIn = 0, countOut = 0;
-    int firstTime = 1;
 
     while (frame < sfinfo.frames && !*stop) {
 
@@ -282,10 +280,6 @@ void ad_play_ogg_file_pitched(const char *path, float volume, viseme_timing_t *t
                 }
             }
 
-            if (firstTime) {
-                firstTime = 0;
-                ad_play_sync_prep(t);
-            }
             sf_writef_float(sndfileOut, fobf, avail);
             free(fobf);
             for (size_t i = 0; i < channels; ++i) free(obf[i]);
@@ -337,5 +331,4 @@ void ad_play_ogg_file_pitched(const char *path, float volume, viseme_timing_t *t
     sf_close(sndfileOut);
 
     rubberband_delete(ts);
-    ad_play_sync_cleanup();
 }